@@ -4,6 +4,11 @@
 #define _NUMBER_H
 
 
+/* Included libraries */
+
+#include <stdint.h>
+
+
 /* Definitions */
 
 #ifdef TRUE
@@ -21,14 +26,39 @@
 #define _TRANS_FUNC_PREC 22
 #endif
 
+/* Defining the limbs used for storing the digits. Each limb holds _SAP_LIMB_DIGITS decimal digits. */
+#define _SAP_LIMB_DIGITS 9
+#define _SAP_LIMB_BASE 1000000000U
+
+/* Number of limbs required to store the specified number of decimal digits */
+#define _SAP_LIMBS(digits) (((digits) + _SAP_LIMB_DIGITS - 1) / _SAP_LIMB_DIGITS)
+
+/* Number of limbs stored inside the structure itself. Numbers that fit need no separate storage. */
+#ifndef _SAP_INLINE_LIMBS
+#define _SAP_INLINE_LIMBS 4
+#endif
+
 /* Struct declarations */
 
+typedef uint32_t sap_limb; /* A single base 10^9 digit of a sap_number */
+
 typedef enum
 {
     POS = 255,
     NEG = -255
 } sign;
 
+/* Mathematical constants available through sap_constant() */
+typedef enum
+{
+    SAP_PI,
+    SAP_E,
+    SAP_LN2,
+    SAP_LN10,
+    SAP_SQRT2,
+    SAP_CONST_COUNT
+} sap_const_id;
+
 typedef struct sap_struct *sap_num;
 
 /* Struct for holding properties and pointers to storage of a sap_number */
@@ -42,14 +72,21 @@ typedef struct sap_struct
 
     int n_len;    /* For number of digits before the decimal point */
     int n_scale;  /* For number of digits after the decimal point */
-
-    /* The structure of the storage is shown as follows:
-       |---(MSB)---Integral---(LSB)---|---(MSB)---Fractional---(LSB)---|
+    int n_exp;    /* For number of lowest limbs that are zero and not stored */
+
+    /* The storage is an array of limbs in base 10^9, starting from the least significant limb.
+       The integral part takes _SAP_LIMBS(n_len) limbs, and the fractional part takes _SAP_LIMBS(n_scale) limbs.
+       The fractional limbs are aligned to the decimal point, so unused digits at the end of the lowest limb are zero.
+       |---(LSB)---Fractional---(MSB)---|---(LSB)---Integral---(MSB)---|
+       The lowest n_exp limbs of this layout are zero and left out, so n_val[0] holds limb n_exp. Trailing zeroes of
+       both parts then take no storage.
      */
-    char *n_ptr;  /* For internal storage. This may be NULL to indicate that 
-                     the value actually points to the storage in another number. */
+    sap_limb *n_ptr; /* For internal storage. The storage may be shared by views of the number, which then differ only
+                        in sign, layout and n_val, and is freed with its last holder. This may be NULL for static storage. */
     
-    char *n_val;  /* For pointer to actual value. */
+    sap_limb *n_val; /* For pointer to actual value. */
+
+    sap_limb n_inline[_SAP_INLINE_LIMBS]; /* Storage of short numbers, which then have n_ptr pointing here. */
 } sap_struct;
 
 
@@ -58,14 +95,14 @@ typedef struct sap_struct
 extern sap_num _zero_;
 extern sap_num _one_;
 extern sap_num _two_;
-extern sap_num _e_;
-extern sap_num _pi_;
 
 
 /* Function prototypes */
 
 void sap_init_number_lib(void);
 
+void sap_free_number_lib(void);
+
 sap_num sap_new_num(int length, int scale);
 
 void sap_free_num(sap_num *op);
@@ -74,6 +111,8 @@ sap_num sap_replicate_num(sap_num op);
 
 sap_num sap_copy_num(sap_num src);
 
+sap_num sap_view_num(sap_num src);
+
 void sap_init_num(sap_num *op);
 
 sap_num sap_str2num(char *ptr);
@@ -82,12 +121,16 @@ sap_num sap_double2num(double val);
 
 sap_num sap_int2num(int val);
 
+sap_num sap_int64_2num(int64_t val);
+
 char *sap_num2str(sap_num op);
 
 double sap_num2double(sap_num op);
 
 int sap_num2int(sap_num op);
 
+int64_t sap_num2int64(sap_num op, int *overflow);
+
 int sap_is_zero(sap_num op);
 
 int sap_is_near_zero(sap_num op, int scale);
@@ -102,6 +145,10 @@ sap_num sap_add(sap_num op1, sap_num op2, int scale_min);
 
 sap_num sap_sub(sap_num op1, sap_num op2, int scale_min);
 
+void sap_add_inplace(sap_num *op1, sap_num op2, int scale_min);
+
+void sap_sub_inplace(sap_num *op1, sap_num op2, int scale_min);
+
 sap_num sap_mul(sap_num op1, sap_num op2, int scale);
 
 sap_num sap_div(sap_num dividend, sap_num divisor, int scale);
@@ -112,6 +159,12 @@ void sap_divmod(sap_num dividend, sap_num divisor, sap_num *quotient, sap_num *r
 
 sap_num sap_sqrt(sap_num op, int scale);
 
+sap_num sap_isqrt(sap_num op);
+
+sap_num sap_root(sap_num op, sap_num degree, int scale);
+
+sap_num sap_iroot(sap_num op, sap_num degree);
+
 sap_num sap_sin(sap_num op, int scale);
 
 sap_num sap_cos(sap_num op, int scale);
@@ -124,4 +177,6 @@ sap_num sap_raise(sap_num base, sap_num expo, int scale);
 
 sap_num sap_exp(sap_num expo, int scale);
 
+sap_num sap_constant(sap_const_id id, int scale);
+
 #endif
\ No newline at end of file
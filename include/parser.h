@@ -26,9 +26,12 @@
 #define _SAP_TEXT_FUNC_SIN    "sin"
 #define _SAP_TEXT_FUNC_COS    "cos"
 #define _SAP_TEXT_FUNC_SQRT   "sqrt"
+#define _SAP_TEXT_FUNC_ISQRT  "isqrt"
 #define _SAP_TEXT_FUNC_ARCTAN "atan"
 #define _SAP_TEXT_FUNC_LN     "ln"
 #define _SAP_TEXT_FUNC_EXP    "exp"
+#define _SAP_TEXT_FUNC_ROOT   "root"
+#define _SAP_TEXT_FUNC_IROOT  "iroot"
 
 
 /* Enum declarations */
@@ -55,11 +58,14 @@ typedef enum sap_token_type
     _SAP_POWER,    /* Power */
 
     _SAP_SQRT,   /* Sqrt */
+    _SAP_ISQRT,  /* Integer sqrt */
     _SAP_SIN,    /* Sin */
     _SAP_COS,    /* Cos */
     _SAP_ARCTAN, /* Arctangent */
     _SAP_LN,     /* Natural Logarithm */
     _SAP_EXP,    /* exp */
+    _SAP_ROOT,   /* N-th root */
+    _SAP_IROOT,  /* Integer n-th root */
 
     _SAP_PAREN_L, /* Left parentheses */
     _SAP_PAREN_R, /* Right parentheses */
@@ -88,6 +94,10 @@ typedef struct sap_token_struct
        The struct has complete control over the array, and _sap_free_token will free the array when necessary. */
     struct sap_token_struct **arg_tokens; 
 
+    /* If it is a function of two arguments, stores the array of tokens of the second argument in the same way.
+       Else, it is NULL. */
+    struct sap_token_struct **arg_tokens2;
+
     int negate; /* TRUE if the evaluation result of this token is to be negated. */
 } sap_token_struct;
 
@@ -102,6 +112,8 @@ int sap_is_operator(sap_token token);
 
 int sap_is_func(sap_token token);
 
+int sap_is_binary_func(sap_token token);
+
 int sap_get_in_prec(sap_token token);
 
 int sap_get_out_prec(sap_token token);
@@ -13,6 +13,8 @@
 
 void sap_init_lib(void);
 
+void sap_free_lib(void);
+
 sap_num sap_execute(char *stmt);
 
 sap_num sap_reset_all(void);
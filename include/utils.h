@@ -46,4 +46,6 @@ void free_expr_array(char ***src);
 
 char *find_right_paren(char *lineptr);
 
+char *find_arg_separator(char *lineptr);
+
 #endif
\ No newline at end of file
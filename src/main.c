@@ -195,7 +195,10 @@ int main(int argc, char **argv)
 #endif
     {
         if (strstr(buf, "quit") != 0 && buf[0] == 'q')
+        {
+            sap_free_lib();
             exit(0);
+        }
         else if (strstr(buf, "help") != 0 && buf[0] == 'h')
             show_instruction();
         /* Some OS don't support history. */
@@ -223,4 +226,6 @@ int main(int argc, char **argv)
         append_to_history(buf);
         buf = NULL;
     }
+
+    sap_free_lib();
 }
\ No newline at end of file
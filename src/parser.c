@@ -63,11 +63,14 @@ int sap_is_func(sap_token token)
     switch (token->type)
     {
     case _SAP_SQRT:
+    case _SAP_ISQRT:
     case _SAP_SIN:
     case _SAP_COS:
     case _SAP_ARCTAN:
     case _SAP_LN:
     case _SAP_EXP:
+    case _SAP_ROOT:
+    case _SAP_IROOT:
     case _SAP_FUNC_CALL:
         return TRUE;
 
@@ -76,6 +79,12 @@ int sap_is_func(sap_token token)
     }
 }
 
+/* Test if a token is a function of two arguments. */
+int sap_is_binary_func(sap_token token)
+{
+    return token->type == _SAP_ROOT || token->type == _SAP_IROOT;
+}
+
 /* Get the IN precedence of an operator in the stack. */
 int sap_get_in_prec(sap_token token)
 {
@@ -195,6 +204,7 @@ static sap_token _sap_new_token(sap_token_type type, char *name, sap_num val, sa
         tmp->arg_tokens = arg_tokens;
     else
         tmp->arg_tokens = NULL;
+    tmp->arg_tokens2 = NULL;
 
     /* Negation */
     tmp->negate = FALSE;
@@ -214,6 +224,8 @@ static void _sap_free_token(sap_token *token)
     sap_free_num(&((*token)->val));
     if ((*token)->arg_tokens != NULL)
         _sap_free_token_array(&((*token)->arg_tokens));
+    if ((*token)->arg_tokens2 != NULL)
+        _sap_free_token_array(&((*token)->arg_tokens2));
     free(*token);
     *token = NULL;
 }
@@ -435,12 +447,18 @@ static sap_token _sap_parse_next_token(char **lineptr)
                 type = _SAP_COS;
             else if (strcmp(buf, _SAP_TEXT_FUNC_SQRT) == 0)
                 type = _SAP_SQRT;
+            else if (strcmp(buf, _SAP_TEXT_FUNC_ISQRT) == 0)
+                type = _SAP_ISQRT;
             else if (strcmp(buf, _SAP_TEXT_FUNC_ARCTAN) == 0)
                 type = _SAP_ARCTAN;
             else if (strcmp(buf, _SAP_TEXT_FUNC_LN) == 0)
                 type = _SAP_LN;
             else if (strcmp(buf, _SAP_TEXT_FUNC_EXP) == 0)
                 type = _SAP_EXP;
+            else if (strcmp(buf, _SAP_TEXT_FUNC_ROOT) == 0)
+                type = _SAP_ROOT;
+            else if (strcmp(buf, _SAP_TEXT_FUNC_IROOT) == 0)
+                type = _SAP_IROOT;
             else
             {
                 type = _SAP_FUNC_CALL;
@@ -460,9 +478,25 @@ static sap_token _sap_parse_next_token(char **lineptr)
             memcpy(buf0, ptr2, len);
             *(buf0 + len) = '\0';
 
+            /* Arguments of a binary function are split at the first comma outside parentheses. */
+            char *comma = NULL;
+            if (type == _SAP_ROOT || type == _SAP_IROOT)
+            {
+                comma = find_arg_separator(buf0);
+                if (*comma == ',')
+                    *comma++ = '\0';
+                else
+                {
+                    sap_warn("Function requires two arguments: ", 1, buf, FALSE);
+                    comma = NULL;
+                }
+            }
+
             arg_tokens = sap_parse_expr(buf0);
 
             result = _sap_new_token(type, NULL, NULL, arg_tokens);
+            if (comma != NULL)
+                result->arg_tokens2 = sap_parse_expr(comma);
 
             /* Clean up. */
             free(buf0);
@@ -566,12 +600,13 @@ void sap_token_trans2num(sap_token token, sap_num val)
     free(token->name);
     token->name = NULL;
     sap_free_tokens(&(token->arg_tokens));
+    sap_free_tokens(&(token->arg_tokens2));
 
     token->type = _SAP_NUMBER;
     token->val = sap_copy_num(val);
     if (token->negate) /* If the result should be negated */
     {
-        sap_num tmp = sap_replicate_num(token->val);
+        sap_num tmp = sap_view_num(token->val);
         sap_free_num(&(token->val));
         token->val = tmp;
         sap_negate(token->val);
@@ -589,6 +624,31 @@ void sap_free_tokens(sap_token **array)
 
 #define _DB_OUT_SIZE 10000
 
+/* Print the tokens of an argument for debug use, separated by commas. Return NULL if there is no argument. */
+static char *_sap_debug_args2text(sap_token *args)
+{
+    if (args == NULL)
+        return NULL;
+
+    char *buf_arg = (char *)malloc(_DB_OUT_SIZE);
+    if (buf_arg == NULL)
+    {
+        printf("Out of memory on debug print.\n");
+        exit(1);
+    }
+    *buf_arg = '\0';
+    sap_token *next = args - 1;
+    do
+    {
+        next++;
+        char *sub_token = _sap_debug_token2text(*next);
+        strcat(buf_arg, sub_token);
+        strcat(buf_arg, ", ");
+        free(sub_token);
+    } while ((*next)->type != _SAP_END_OF_STMT);
+    return buf_arg;
+}
+
 /* (Deprecated) Print token info for debug use. This function is not strictly written and lacks generosity.
    Forbidden to use in production.
    The upper bound length for subexpressions is capped at _DB_OUT_SIZE, otherwise segmentation fault. */
@@ -606,33 +666,17 @@ char *_sap_debug_token2text(sap_token token)
         exit(1);
     }
 
-    char *buf_arg = NULL; /* Buffer for sub-tokens. */
-    if (token->arg_tokens != NULL)
-    {
-        buf_arg = (char *)malloc(_DB_OUT_SIZE);
-        if (buf_arg == NULL)
-        {
-            printf("Out of memory on debug print.\n");
-            exit(1);
-        }
-        *buf_arg = '\0';
-        sap_token *next = token->arg_tokens - 1;
-        do
-        {
-            next++;
-            char *sub_token = _sap_debug_token2text(*next);
-            strcat(buf_arg, sub_token);
-            strcat(buf_arg, ", ");
-            free(sub_token);
-        } while ((*next)->type != _SAP_END_OF_STMT);
-    }
-    sprintf(buf, "{Token type=%d, negate=%d, token name=%s, token val=%s, arguments=[%s]}",
+    char *buf_arg = _sap_debug_args2text(token->arg_tokens);   /* Buffer for sub-tokens. */
+    char *buf_arg2 = _sap_debug_args2text(token->arg_tokens2); /* Buffer for sub-tokens of the second argument. */
+    sprintf(buf, "{Token type=%d, negate=%d, token name=%s, token val=%s, arguments=[%s], arguments2=[%s]}",
             token->type,
             token->negate,
             token->name == NULL ? "NULL" : token->name,
             sap_num2str(token->val),
-            buf_arg == NULL ? "NULL" : buf_arg);
+            buf_arg == NULL ? "NULL" : buf_arg,
+            buf_arg2 == NULL ? "NULL" : buf_arg2);
     free(buf_arg);
+    free(buf_arg2);
     return buf;
 }
 
@@ -40,6 +40,13 @@ void sap_init_lib(void)
     symbols = lut_new_table();
 }
 
+/* Release the whole sap library at shutdown. No number may be used afterwards. */
+void sap_free_lib(void)
+{
+    lut_free_table(&symbols);
+    sap_free_number_lib();
+}
+
 /* Convert an infix expression to postfix.
    The resultant array contains sap_token in parameter=tokens, or is NULL if the expression is invalid.
    The array must be freed manually.
@@ -138,7 +145,7 @@ static sap_token _sap_evaluate_operand(sap_token token)
     {
         if (token->negate) /* If the result should be negated */
         {
-            sap_num tmp = sap_replicate_num(token->val);
+            sap_num tmp = sap_view_num(token->val);
             sap_free_num(&(token->val));
             token->val = tmp;
             sap_negate(token->val);
@@ -172,7 +179,8 @@ static sap_token _sap_evaluate_operand(sap_token token)
     }
     else if (sap_is_func(token))
     {
-        sap_num tmp0, tmp1; /* Temporary results */
+        sap_num tmp0, tmp1;  /* Temporary results */
+        sap_num tmp2 = NULL; /* The second argument of a binary function */
 
         tmp0 = _sap_evaluate(&(token->arg_tokens));
         if (tmp0 == NULL)
@@ -180,11 +188,24 @@ static sap_token _sap_evaluate_operand(sap_token token)
             sap_warn("Invalid arguments.", 0);
             tmp0 = sap_copy_num(_zero_);
         }
+        if (sap_is_binary_func(token))
+        {
+            if (token->arg_tokens2 != NULL)
+                tmp2 = _sap_evaluate(&(token->arg_tokens2));
+            if (tmp2 == NULL)
+            {
+                sap_warn("Invalid arguments.", 0);
+                tmp2 = sap_copy_num(_zero_);
+            }
+        }
         switch (token->type)
         {
         case _SAP_SQRT:
             tmp1 = sap_sqrt(tmp0, tmp0->n_scale);
             break;
+        case _SAP_ISQRT:
+            tmp1 = sap_isqrt(tmp0);
+            break;
         case _SAP_SIN:
             tmp1 = sap_sin(tmp0, MAX(tmp0->n_scale, _TRANS_FUNC_MIN_SCALE));
             break;
@@ -200,6 +221,12 @@ static sap_token _sap_evaluate_operand(sap_token token)
         case _SAP_EXP:
             tmp1 = sap_exp(tmp0, MAX(tmp0->n_scale, _TRANS_FUNC_MIN_SCALE));
             break;
+        case _SAP_ROOT:
+            tmp1 = sap_root(tmp0, tmp2, tmp0->n_scale);
+            break;
+        case _SAP_IROOT:
+            tmp1 = sap_iroot(tmp0, tmp2);
+            break;
         case _SAP_FUNC_CALL:
             /* Reserved for future function table invoke. */
         default:
@@ -210,6 +237,7 @@ static sap_token _sap_evaluate_operand(sap_token token)
         sap_token_trans2num(token, tmp1);
         sap_free_num(&tmp0);
         sap_free_num(&tmp1);
+        sap_free_num(&tmp2);
     }
 
     return token;
@@ -301,6 +329,7 @@ static sap_num _sap_evaluate(sap_token **tokens)
                 {
                     tmp2 = sap_copy_num(_sap_evaluate_operand(tok2)->val);
                     tmp1 = sap_copy_num(_sap_evaluate_operand(tok1)->val);
+                    sap_free_num(&(tok1->val)); /* An intermediate left operand is then held by tmp1 alone, and updated in place. */
                     switch ((*ptr)->type)
                     {
                     case _SAP_LESS:
@@ -323,10 +352,12 @@ static sap_num _sap_evaluate(sap_token **tokens)
                         break;
 
                     case _SAP_ADD:
-                        tmp0 = sap_add(tmp1, tmp2, MAX(tmp1->n_scale, tmp2->n_scale));
+                        sap_add_inplace(&tmp1, tmp2, MAX(tmp1->n_scale, tmp2->n_scale));
+                        tmp0 = sap_copy_num(tmp1);
                         break;
                     case _SAP_MINUS:
-                        tmp0 = sap_sub(tmp1, tmp2, MAX(tmp1->n_scale, tmp2->n_scale));
+                        sap_sub_inplace(&tmp1, tmp2, MAX(tmp1->n_scale, tmp2->n_scale));
+                        tmp0 = sap_copy_num(tmp1);
                         break;
                     case _SAP_MULTIPLY:
                         tmp0 = sap_mul(tmp1, tmp2, MAX(tmp1->n_scale, tmp2->n_scale));
@@ -4,16 +4,20 @@
 #include "number.h"
 #include "lut.h"
 #include "parser.h"
+#include "sap.h"
 #include "utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 
 /* Function declarations */
 
 static void test_number(void);
 
+static void test_constant(void);
+
 static void test_lut(void);
 
 static void test_parser(void);
@@ -26,6 +30,7 @@ static void test_sap(void);
 void test(void)
 {
     test_number();
+    test_constant();
     test_lut();
     test_parser();
     test_util_fetch_expr();
@@ -76,6 +81,31 @@ test_number(void)
     sap_free_num(&n2);
 }
 
+static void
+test_constant(void)
+{
+    /* Regression test for truncating a view of the cached or built-in digits, which used to write into the shared
+       storage: every constant at every small scale must match the leading digits of the same constant. */
+    int failed = 0;
+    for (int id = 0; id < SAP_CONST_COUNT; ++id)
+    {
+        sap_num full = sap_constant(id, 200);
+        char *q = sap_num2str(full);
+        for (int scale = 1; scale <= 200; ++scale)
+        {
+            sap_num tmp = sap_constant(id, scale);
+            char *p = sap_num2str(tmp);
+            if (tmp->n_scale != scale || strlen(p) != (size_t)scale + 2 || strncmp(p, q, scale + 2) != 0)
+                failed++;
+            free(p);
+            sap_free_num(&tmp);
+        }
+        free(q);
+        sap_free_num(&full);
+    }
+    printf("Constants at scales 1 to 200: %s\n", failed ? "FAILED" : "passed");
+}
+
 static void
 test_lut(void)
 {
@@ -83,8 +113,8 @@ test_lut(void)
     printf("Table newed.\n");
     sap_num one = sap_copy_num(_one_);
     sap_num two = sap_copy_num(_two_);
-    sap_num e = sap_copy_num(_e_);
-    sap_num pi = sap_copy_num(_pi_);
+    sap_num e = sap_constant(SAP_E, 20);
+    sap_num pi = sap_constant(SAP_PI, 20);
     lut_insert(table, "xy", one);
     lut_insert(table, "yz", two);
     lut_insert(table, "pi", pi);
@@ -159,4 +189,15 @@ test_util_fetch_expr(void)
 static void
 test_sap(void)
 {
+    /* exp, like the other functions, keeps the scale of its argument, but at least _TRANS_FUNC_MIN_SCALE digits. */
+    char *exprs[] = {"exp(1)", "exp(1.00000)"};
+    char *expected[] = {"2.718", "2.71828"};
+    for (int i = 0; i < 2; ++i)
+    {
+        sap_num tmp = sap_execute(exprs[i]);
+        char *p = sap_num2str(tmp);
+        printf("%s = %s: %s\n", exprs[i], p, strcmp(p, expected[i]) == 0 ? "passed" : "FAILED");
+        free(p);
+        sap_free_num(&tmp);
+    }
 }
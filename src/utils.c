@@ -189,4 +189,22 @@ char *find_right_paren(char *lineptr)
         lineptr++;
     }
     return lineptr;
-}
\ No newline at end of file
+}
+
+/* Find the first comma that is not enclosed in parentheses, which separates the arguments of a function.
+   Return a pointer to the comma. The pointer will point to the end of string if not found. */
+char *find_arg_separator(char *lineptr)
+{
+    int cnt = 0;
+    while (*lineptr != '\0')
+    {
+        if (*lineptr == '(')
+            cnt++;
+        else if (*lineptr == ')')
+            cnt--;
+        else if (*lineptr == ',' && cnt == 0)
+            break;
+        lineptr++;
+    }
+    return lineptr;
+}
@@ -0,0 +1,58 @@
+/*  This file generates the constant tables used by number.c, so that the
+    calculator does not compute the common constants at run time.
+    Usage: gen_constants digits output_file
+ *******************************************************************/
+
+#include "sapdefs.h"
+
+/* Definition of constants */
+int quiet = TRUE;
+int debug = FALSE;
+
+/* Write the limbs of op, which must have exactly scale digits after the decimal point, as a C array. */
+static void
+emit_table(FILE *file, const char *name, sap_num op, int scale)
+{
+    sap_num tmp = sap_add(op, _zero_, scale); /* Pad to exactly scale digits */
+    int size = _SAP_LIMBS(tmp->n_len) + _SAP_LIMBS(tmp->n_scale);
+
+    fprintf(file, "static const sap_limb %s[%d] = {", name, size);
+    for (int i = 0; i < size; ++i)
+        fprintf(file, "%s%u,", (i % 8 == 0) ? "\n    " : " ", tmp->n_val[i]);
+    fprintf(file, "\n};\n\n");
+    sap_free_num(&tmp);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 || atoi(argv[1]) <= 0)
+    {
+        fprintf(stderr, "usage: %s digits output_file\n", argv[0]);
+        return 1;
+    }
+    int scale = atoi(argv[1]);
+    FILE *file = fopen(argv[2], "w");
+    if (file == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    sap_init_number_lib();
+    const char *names[SAP_CONST_COUNT] = {"_sap_table_pi", "_sap_table_e", "_sap_table_ln2", "_sap_table_ln10",
+                                          "_sap_table_sqrt2"};
+
+    fprintf(file, "/* Constant tables for number.c, generated by gen_constants. Do not edit. */\n\n");
+    fprintf(file, "#ifndef _SAPCONST_H\n#define _SAPCONST_H\n\n");
+    fprintf(file, "/* Number of digits after the decimal point in every table */\n");
+    fprintf(file, "#define _SAP_TABLE_SCALE %d\n\n", scale);
+    for (int i = 0; i < SAP_CONST_COUNT; ++i)
+    {
+        sap_num value = sap_constant(i, scale);
+        emit_table(file, names[i], value, scale);
+        sap_free_num(&value);
+    }
+    fprintf(file, "#endif\n");
+
+    return fclose(file) == 0 ? 0 : 1;
+}